@@ -1,7 +1,138 @@
 #include "opt/opt.h"
+#include <cstring>
 
 namespace opt {
 
+    float to_float(bf16 h)
+    {
+        std::uint32_t bits = std::uint32_t(h.bits) << 16;
+        float v;
+        std::memcpy(&v, &bits, sizeof(float));
+        return v;
+    }
+
+    float to_float(fp16 h)
+    {
+        std::uint32_t sign = std::uint32_t(h.bits & 0x8000) << 16;
+        std::uint32_t exp = (h.bits >> 10) & 0x1f;
+        std::uint32_t mant = h.bits & 0x3ff;
+        std::uint32_t bits;
+
+        if (exp == 0 && mant == 0) {
+            bits = sign;
+        } else if (exp == 0) {
+            // subnormal, renormalize for fp32
+            exp = 113;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        } else if (exp == 0x1f) {
+            bits = sign | 0x7f800000 | (mant << 13);
+        } else {
+            bits = sign | ((exp + 112) << 23) | (mant << 13);
+        }
+
+        float v;
+        std::memcpy(&v, &bits, sizeof(float));
+        return v;
+    }
+
+    bf16 to_bf16(float v)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(float));
+
+        if ((bits & 0x7fffffff) > 0x7f800000) {
+            return bf16 { std::uint16_t((bits >> 16) | 0x40) };
+        }
+
+        // round to nearest even
+        bits += 0x7fff + ((bits >> 16) & 1);
+
+        return bf16 { std::uint16_t(bits >> 16) };
+    }
+
+    fp16 to_fp16(float v)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(float));
+
+        std::uint16_t sign = (bits >> 16) & 0x8000;
+        bits &= 0x7fffffff;
+
+        if (bits > 0x7f800000) {
+            return fp16 { std::uint16_t(sign | 0x7e00) };
+        } else if (bits >= 0x477ff000) {
+            // rounds past 65504
+            return fp16 { std::uint16_t(sign | 0x7c00) };
+        } else if (bits <= 0x33000000) {
+            // rounds to zero
+            return fp16 { sign };
+        }
+
+        std::uint32_t r;
+        std::uint32_t rem;
+        std::uint32_t half;
+
+        if (bits < 0x38800000) {
+            int shift = 126 - int(bits >> 23);
+            std::uint32_t mant = (bits & 0x7fffff) | 0x800000;
+            r = mant >> shift;
+            rem = mant & ((1u << shift) - 1);
+            half = 1u << (shift - 1);
+        } else {
+            r = (bits - (112u << 23)) >> 13;
+            rem = bits & 0x1fff;
+            half = 0x1000;
+        }
+
+        // round to nearest even
+        if (rem > half || (rem == half && (r & 1))) {
+            ++r;
+        }
+
+        return fp16 { std::uint16_t(sign | r) };
+    }
+
+    bool has_overflow(std::vector<bf16> const& grad)
+    {
+        for (auto& h: grad) {
+            if ((h.bits & 0x7f80) == 0x7f80) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool has_overflow(std::vector<fp16> const& grad)
+    {
+        for (auto& h: grad) {
+            if ((h.bits & 0x7c00) == 0x7c00) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void update_loss_scale(loss_scaler& scaler, bool overflow)
+    {
+        if (overflow) {
+            scaler.scale *= scaler.backoff;
+            scaler.good_steps = 0;
+        } else {
+            ++scaler.good_steps;
+
+            if (scaler.good_steps == scaler.growth_interval) {
+                scaler.scale *= scaler.growth;
+                scaler.good_steps = 0;
+            }
+        }
+    }
+
     void const_step_update(ebt::SparseVector& theta,
         ebt::SparseVector const& grad,
         double step_size)
@@ -404,4 +535,174 @@ namespace opt {
             time, alpha, beta1, beta2);
     }
 
+    namespace {
+
+        void store(bf16& h, float v)
+        {
+            h = to_bf16(v);
+        }
+
+        void store(fp16& h, float v)
+        {
+            h = to_fp16(v);
+        }
+
+        template <class half>
+        void mixed_momentum_update(std::vector<float>& theta,
+            half *theta_half_data,
+            std::vector<half> const& grad,
+            std::vector<float>& update,
+            float momentum,
+            float step_size,
+            float loss_scale)
+        {
+            int size = theta.size();
+            float *theta_data = theta.data();
+            half const *grad_data = grad.data();
+            float *update_data = update.data();
+            float grad_factor = (1 - momentum) / loss_scale;
+
+            for (int i = 0; i < size; ++i) {
+                update_data[i] = update_data[i] * momentum
+                    + to_float(grad_data[i]) * grad_factor;
+                theta_data[i] -= update_data[i] * step_size;
+
+                if (theta_half_data != nullptr) {
+                    store(theta_half_data[i], theta_data[i]);
+                }
+            }
+        }
+
+        template <class half>
+        void mixed_adam_update(std::vector<float>& theta,
+            half *theta_half_data,
+            std::vector<half> const& loss_grad,
+            std::vector<float>& first_moment,
+            std::vector<float>& second_moment,
+            int& time, float alpha, float beta1, float beta2,
+            float loss_scale)
+        {
+            int size = theta.size();
+            float *theta_data = theta.data();
+            half const *loss_grad_data = loss_grad.data();
+            float *first_moment_data = first_moment.data();
+            float *second_moment_data = second_moment.data();
+
+            float inv_scale = 1 / loss_scale;
+            float b1 = 1 - std::pow(beta1, time + 1);
+            float b2 = 1 - std::pow(beta2, time + 1);
+
+            for (int i = 0; i < size; ++i) {
+                float g = to_float(loss_grad_data[i]) * inv_scale;
+
+                first_moment_data[i] = first_moment_data[i] * beta1
+                    + g * (1 - beta1);
+                second_moment_data[i] = second_moment_data[i] * beta2
+                    + g * g * (1 - beta2);
+
+                theta_data[i] -= alpha * first_moment_data[i] / b1
+                    / (std::sqrt(second_moment_data[i] / b2) + 1e-8f);
+
+                if (theta_half_data != nullptr) {
+                    store(theta_half_data[i], theta_data[i]);
+                }
+            }
+
+            ++time;
+        }
+
+    }
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<bf16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale)
+    {
+        mixed_momentum_update<bf16>(theta, nullptr, grad, update,
+            momentum, step_size, loss_scale);
+    }
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<fp16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale)
+    {
+        mixed_momentum_update<fp16>(theta, nullptr, grad, update,
+            momentum, step_size, loss_scale);
+    }
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<bf16>& theta_half,
+        std::vector<bf16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale)
+    {
+        mixed_momentum_update(theta, theta_half.data(), grad, update,
+            momentum, step_size, loss_scale);
+    }
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<fp16>& theta_half,
+        std::vector<fp16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale)
+    {
+        mixed_momentum_update(theta, theta_half.data(), grad, update,
+            momentum, step_size, loss_scale);
+    }
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<bf16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale)
+    {
+        mixed_adam_update<bf16>(theta, nullptr, loss_grad, first_moment, second_moment,
+            time, alpha, beta1, beta2, loss_scale);
+    }
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<fp16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale)
+    {
+        mixed_adam_update<fp16>(theta, nullptr, loss_grad, first_moment, second_moment,
+            time, alpha, beta1, beta2, loss_scale);
+    }
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<bf16>& theta_half,
+        std::vector<bf16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale)
+    {
+        mixed_adam_update(theta, theta_half.data(), loss_grad, first_moment, second_moment,
+            time, alpha, beta1, beta2, loss_scale);
+    }
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<fp16>& theta_half,
+        std::vector<fp16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale)
+    {
+        mixed_adam_update(theta, theta_half.data(), loss_grad, first_moment, second_moment,
+            time, alpha, beta1, beta2, loss_scale);
+    }
+
 }
@@ -3,9 +3,38 @@
 
 #include "ebt/ebt.h"
 #include "la/la-cpu.h"
+#include <cstdint>
 
 namespace opt {
 
+    struct bf16 {
+        std::uint16_t bits;
+    };
+
+    struct fp16 {
+        std::uint16_t bits;
+    };
+
+    float to_float(bf16 h);
+    float to_float(fp16 h);
+    bf16 to_bf16(float v);
+    fp16 to_fp16(float v);
+
+    // dynamic loss scaling: the scale is backed off on overflow
+    // and grown after growth_interval consecutive good steps
+    struct loss_scaler {
+        float scale = 65536;
+        float growth = 2;
+        float backoff = 0.5;
+        int growth_interval = 2000;
+        int good_steps = 0;
+    };
+
+    bool has_overflow(std::vector<bf16> const& grad);
+    bool has_overflow(std::vector<fp16> const& grad);
+
+    void update_loss_scale(loss_scaler& scaler, bool overflow);
+
     void const_step_update(ebt::SparseVector& theta,
         ebt::SparseVector const& grad,
         double step_size);
@@ -150,6 +179,71 @@ namespace opt {
         la::cpu::tensor_like<double>& second_moment,
         int& time, double alpha, double beta1, double beta2);
 
+    // mixed-precision updates: the gradient is half precision and scaled
+    // by loss_scale, while theta and the optimizer state are fp32 master
+    // copies; the theta_half overloads also write theta back for the next
+    // forward pass.  Check has_overflow on every gradient before calling.
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<bf16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale);
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<fp16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale);
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<bf16>& theta_half,
+        std::vector<bf16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale);
+
+    void const_step_update_momentum(std::vector<float>& theta,
+        std::vector<fp16>& theta_half,
+        std::vector<fp16> const& grad,
+        std::vector<float>& update,
+        float momentum,
+        float step_size,
+        float loss_scale);
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<bf16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale);
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<fp16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale);
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<bf16>& theta_half,
+        std::vector<bf16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale);
+
+    void adam_update(std::vector<float>& theta,
+        std::vector<fp16>& theta_half,
+        std::vector<fp16> const& loss_grad,
+        std::vector<float>& first_moment,
+        std::vector<float>& second_moment,
+        int& time, float alpha, float beta1, float beta2,
+        float loss_scale);
+
 }
 
 #endif